@@ -0,0 +1,294 @@
+#!/bin/bash
+#
+# Workload benchmark for snapshotfs.
+#
+# Starts a private sshd on localhost, serving a generated data set through its
+# internal sftp server, injects latency and bandwidth limits on its port with
+# tc netem, and runs each workload on a fresh mount, so the stats file of the
+# mount covers exactly one workload.  Each workload runs with an empty cache
+# (cold) and again with the cache left by the cold run (warm), on multi and
+# single threaded mounts.
+#
+# Runs as root: sshd checks the password through PAM, and netem changes lo.
+# The settings below can be overridden by environment variables.
+
+BENCH_USER=${BENCH_USER:-}					# Existing local user that sshd authenticates
+BENCH_PW=${BENCH_PW:-}						# Password of BENCH_USER
+BENCH_PORT=${BENCH_PORT:-2222}
+BENCH_RTT_MS=${BENCH_RTT_MS:-20}			# Round trip time added to the sshd port, 0 for none
+BENCH_RATE=${BENCH_RATE:-100mbit}			# Bandwidth limit in each direction, empty for none
+BENCH_DIRS=${BENCH_DIRS:-20}
+BENCH_FILES=${BENCH_FILES:-50}				# Small files per directory
+BENCH_FILE_KB=${BENCH_FILE_KB:-4}
+BENCH_LARGE_MB=${BENCH_LARGE_MB:-64}		# Large file used by the read workloads
+BENCH_RANDOM_READS=${BENCH_RANDOM_READS:-500}	# 64K reads at random offsets
+BENCH_WRITE_MB=${BENCH_WRITE_MB:-16}
+BENCH_JOBS=${BENCH_JOBS:-8}					# Concurrent client processes on multi threaded mounts
+BENCH_WORKLOADS=${BENCH_WORKLOADS:-"stat ls seqread randread open write"}
+BENCH_THREADS=${BENCH_THREADS:-"multi single"}
+BENCH_OPTIONS=${BENCH_OPTIONS:-}			# Extra snapshotfs options, e.g. "--sparse"
+BENCH_DIR=${BENCH_DIR:-/tmp/snapshotfs-bench}
+
+STATS_FILE=".%_snapshotfs_stats"
+SNAPSHOTFS=$(cd "$(dirname "$0")" && pwd)/snapshotfs
+REMOTE=$BENCH_DIR/remote
+MOUNT_POINT=$BENCH_DIR/mnt
+CACHE_DIR=$BENCH_DIR/cache
+SSHD_DIR=$BENCH_DIR/sshd
+LOG=$BENCH_DIR/bench.log
+NETEM=false
+
+usage()
+{
+	echo "usage: BENCH_USER=user BENCH_PW=password bench.sh"
+	echo "  Settings (environment variables):"
+	sed -n 's/^\(BENCH_[A-Z_]*\)=\${[A-Z_]*:-\(.*\)}[ \t]*\(#.*\)\{0,1\}$/    \1=\2 \3/p' "$0"
+	exit 1
+}
+
+fail()
+{
+	echo "$*" >&2
+	cleanup
+	exit 1
+}
+
+now()
+{
+	date +%s.%N
+}
+
+unmount()
+{
+	if mountpoint -q "$MOUNT_POINT"; then
+		fusermount -u "$MOUNT_POINT" 2>/dev/null || umount "$MOUNT_POINT"
+	fi
+	# The metadata snapshot is written when snapshotfs exits
+	for i in $(seq 100); do
+		pgrep -f "snapshotfs .* $MOUNT_POINT" > /dev/null || break
+		sleep 0.1
+	done
+}
+
+cleanup()
+{
+	unmount
+	if [ -f "$SSHD_DIR/sshd.pid" ]; then
+		kill "$(cat "$SSHD_DIR/sshd.pid")" 2>/dev/null
+		rm -f "$SSHD_DIR/sshd.pid"
+	fi
+	if $NETEM; then
+		tc qdisc del dev lo root 2>/dev/null
+		NETEM=false
+	fi
+}
+
+start_sshd()
+{
+	mkdir -p "$SSHD_DIR"
+	[ -f "$SSHD_DIR/host_key" ] || ssh-keygen -q -t ed25519 -N "" -f "$SSHD_DIR/host_key" || fail "ssh-keygen failed"
+	cat > "$SSHD_DIR/sshd_config" <<-EOF
+		Port $BENCH_PORT
+		ListenAddress 127.0.0.1
+		HostKey $SSHD_DIR/host_key
+		PidFile $SSHD_DIR/sshd.pid
+		PasswordAuthentication yes
+		KbdInteractiveAuthentication no
+		UsePAM yes
+		AllowUsers $BENCH_USER
+		MaxStartups 100
+		MaxSessions 100
+		Subsystem sftp internal-sftp
+	EOF
+	mkdir -p /run/sshd
+	$(command -v sshd || echo /usr/sbin/sshd) -f "$SSHD_DIR/sshd_config" -E "$SSHD_DIR/sshd.log" || fail "sshd failed, see $SSHD_DIR/sshd.log"
+}
+
+# Delay and throttle only the packets to and from the sshd port
+start_netem()
+{
+	[ "$BENCH_RTT_MS" = 0 ] && [ -z "$BENCH_RATE" ] && return
+
+	local netem="netem delay $((BENCH_RTT_MS / 2))ms"
+	[ -n "$BENCH_RATE" ] && netem="$netem rate $BENCH_RATE"
+	tc qdisc del dev lo root 2>/dev/null
+	if tc qdisc add dev lo root handle 1: prio bands 4 &&
+		tc qdisc add dev lo parent 1:4 handle 40: $netem &&
+		tc filter add dev lo parent 1: protocol ip u32 match ip dport "$BENCH_PORT" 0xffff flowid 1:4 &&
+		tc filter add dev lo parent 1: protocol ip u32 match ip sport "$BENCH_PORT" 0xffff flowid 1:4; then
+		NETEM=true
+	else
+		tc qdisc del dev lo root 2>/dev/null
+		fail "tc netem failed; set BENCH_RTT_MS=0 BENCH_RATE= to run without injected latency"
+	fi
+}
+
+create_data()
+{
+	rm -rf "$REMOTE"
+	mkdir -p "$REMOTE"
+	for d in $(seq -w 1 "$BENCH_DIRS"); do
+		mkdir "$REMOTE/d$d"
+		for f in $(seq -w 1 "$BENCH_FILES"); do
+			head -c $((BENCH_FILE_KB * 1024)) /dev/urandom > "$REMOTE/d$d/f$f"
+		done
+	done
+	head -c $((BENCH_LARGE_MB * 1024 * 1024)) /dev/urandom > "$REMOTE/large.bin"
+	chown -R "$BENCH_USER" "$REMOTE"
+
+	(cd "$REMOTE" && find . -path ./large.bin -prune -o -type f -print | sed "s|^\.|$MOUNT_POINT|") > "$BENCH_DIR/files.txt"
+
+	# Same offsets for every run
+	RANDOM=42
+	local blocks=$((BENCH_LARGE_MB * 16))
+	for i in $(seq "$BENCH_RANDOM_READS"); do
+		echo $(( (RANDOM << 15 | RANDOM) % blocks ))
+	done > "$BENCH_DIR/offsets.txt"
+}
+
+# mount threads cache
+mount_fs()
+{
+	local options="$BENCH_OPTIONS"
+	[ "$1" = single ] && options="$options --singlethread"
+	[ "$2" = cold ] && rm -rf "$CACHE_DIR"
+	mkdir -p "$MOUNT_POINT" "$CACHE_DIR"
+	"$SNAPSHOTFS" "$BENCH_USER@127.0.0.1:$REMOTE" "$MOUNT_POINT" -c "$CACHE_DIR" -p "$BENCH_PORT" -pw "$BENCH_PW" $options >> "$LOG" 2>&1 ||
+		fail "mount failed, see $LOG"
+}
+
+# Sum the byte counts dd reported in a stderr log
+dd_bytes()
+{
+	awk '/ bytes / {bytes += $1} END {print bytes + 0}' "$1"
+}
+
+# run workload jobs
+# Sets BYTES to the bytes actually read or written.  Fails if a command
+# failed or moved fewer bytes than expected.
+run_workload()
+{
+	local errors=$BENCH_DIR/workload.err
+	local expected=0
+	local rc=0
+	BYTES=0
+	: > "$errors"
+	case $1 in
+	stat)
+		xargs -a "$BENCH_DIR/files.txt" -P "$2" -n 100 stat -L > /dev/null 2>> "$errors" || rc=$?
+		;;
+	ls)
+		ls -lR "$MOUNT_POINT" > /dev/null 2>> "$errors" || rc=$?
+		;;
+	seqread)
+		LC_ALL=C dd if="$MOUNT_POINT/large.bin" of=/dev/null bs=1M 2>> "$errors" || rc=$?
+		BYTES=$(dd_bytes "$errors")
+		expected=$((BENCH_LARGE_MB * 1024 * 1024))
+		;;
+	randread)
+		LC_ALL=C xargs -a "$BENCH_DIR/offsets.txt" -P "$2" -I{} dd if="$MOUNT_POINT/large.bin" of=/dev/null bs=64K count=1 skip={} 2>> "$errors" || rc=$?
+		BYTES=$(dd_bytes "$errors")
+		expected=$((BENCH_RANDOM_READS * 64 * 1024))
+		;;
+	open)
+		xargs -a "$BENCH_DIR/files.txt" -P "$2" -n 20 cat 2>> "$errors" | wc -c > "$BENCH_DIR/workload.bytes"
+		rc=${PIPESTATUS[0]}
+		BYTES=$(cat "$BENCH_DIR/workload.bytes")
+		expected=$(($(wc -l < "$BENCH_DIR/files.txt") * BENCH_FILE_KB * 1024))
+		;;
+	write)
+		# A new file every run; fsync waits for the upload
+		LC_ALL=C dd if=/dev/zero of="$MOUNT_POINT/write-$RUN.bin" bs=1M count="$BENCH_WRITE_MB" conv=fsync 2>> "$errors" || rc=$?
+		BYTES=$(dd_bytes "$errors")
+		expected=$((BENCH_WRITE_MB * 1024 * 1024))
+		;;
+	esac
+
+	if [ "$rc" != 0 ] || [ "$BYTES" -lt "$expected" ]; then
+		echo "$1 workload failed rc=$rc bytes=$BYTES expected=$expected" >&2
+		grep -v -e " records in" -e " records out" -e " bytes " "$errors" | head -5 >&2
+		return 1
+	fi
+	return 0
+}
+
+# FUSE operation whose latency is reported for a workload
+workload_op()
+{
+	case $1 in
+	stat) echo getattr ;;
+	ls) echo getdir ;;
+	seqread|randread) echo read ;;
+	open) echo open ;;
+	write) echo write ;;
+	esac
+}
+
+print_header()
+{
+	echo "snapshotfs bench $(cd "$(dirname "$0")" && git describe --always --dirty 2>/dev/null)"
+	echo "rtt=${BENCH_RTT_MS}ms rate=${BENCH_RATE:-unlimited} files=$((BENCH_DIRS * BENCH_FILES))x${BENCH_FILE_KB}K large=${BENCH_LARGE_MB}M jobs=$BENCH_JOBS options='$BENCH_OPTIONS'"
+	echo
+	printf "%-7s %-5s %-9s %8s %8s %10s %8s %-8s %10s %10s %10s %12s\n" \
+		threads cache workload ops secs ops/s MB/s op p50_us p99_us rmt_calls rmt_bytes
+}
+
+# threads cache workload
+bench()
+{
+	local jobs=$BENCH_JOBS
+	[ "$1" = single ] && jobs=1
+	RUN=$((RUN + 1))
+
+	mount_fs "$1" "$2"
+	local start=$(now)
+	if ! run_workload "$3" $jobs; then
+		fail "$1 $2 $3 run failed, see $BENCH_DIR/workload.err and $LOG"
+	fi
+	local end=$(now)
+	local stats=$(cat "$MOUNT_POINT/$STATS_FILE")
+	unmount
+
+	echo "$stats" > "$BENCH_DIR/stats-$1-$2-$3.txt"
+	local op=$(workload_op "$3")
+	echo "$stats" | awk -v threads="$1" -v cache="$2" -v workload="$3" -v op="$op" \
+		-v start="$start" -v end="$end" -v bytes="$BYTES" '
+		$1 == op {count = $2; p50 = $5; p99 = $6}
+		$1 ~ /^rmt\./ {rmt += $2}
+		$1 == "bytes.downloaded" || $1 == "bytes.uploaded" {rmtBytes += $2}
+		END {
+			secs = end - start
+			if(secs <= 0) secs = 0.001
+			printf "%-7s %-5s %-9s %8d %8.2f %10.1f %8.2f %-8s %10d %10d %10d %12d\n",
+				threads, cache, workload, count, secs, count / secs, bytes / secs / 1048576,
+				op, p50, p99, rmt, rmtBytes
+		}'
+}
+
+[ "$1" = "-h" ] || [ "$1" = "--help" ] && usage
+[ -z "$BENCH_USER" ] || [ -z "$BENCH_PW" ] && usage
+[ "$(id -u)" = 0 ] || fail "bench.sh must run as root"
+[ -x "$SNAPSHOTFS" ] || fail "$SNAPSHOTFS not found (run make)"
+id "$BENCH_USER" > /dev/null 2>&1 || fail "User $BENCH_USER doesn't exist"
+
+trap 'cleanup; exit 1' INT TERM
+
+mkdir -p "$BENCH_DIR"
+: > "$LOG"
+create_data
+start_sshd
+start_netem
+
+RUN=0
+print_header
+for threads in $BENCH_THREADS; do
+	for workload in $BENCH_WORKLOADS; do
+		for cache in cold warm; do
+			bench $threads $cache $workload
+		done
+	done
+done
+
+cleanup
+echo
+echo "Stats file of each run: $BENCH_DIR/stats-*.txt"
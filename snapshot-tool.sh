@@ -8,7 +8,8 @@ CACHE_DIR=~/.cache/snapshotfs
 # Usage
 usage()
 {
-	echo "usage: snapshot-tool.sh OPERATION mountpoint [optional parameters]"
+	echo "usage: snapshot-tool.sh [-c cachedir] OPERATION mountpoint [optional parameters]"
+	echo "  -c cachedir        Cache directory given to snapshotfs -c.  Default is ~/.cache/snapshotfs"
 	echo "  OPERATIONS:"
 	echo "    refresh-cache    Update stale cache entries and remove deleted files"
 	echo "        Syntax: snapshot-tool.sh refresh-cache mountpoint [user@host:/dir]"
@@ -16,7 +17,7 @@ usage()
 	echo "        Syntax: snapshot-tool.sh clean-cache mountpoint"
 	echo "    delete-cache     Delete all directories and files stored in the cache."
 	echo "        Syntax: snapshot-tool.sh delete-cache mountpoint"
-	echo "    create-snapshot  Create a snapshot of the cache."
+	echo "    create-snapshot  Create a snapshot of the cache and its metadata."
 	echo "        Syntax: snapshot-tool.sh create-snapshot mountpoint snapshot-name"
 	echo "    delete-snapshot  Delete a snapshot."
 	echo "        Syntax: snapshot-tool.sh delete-snapshot snapshot-name"
@@ -25,12 +26,22 @@ usage()
 	echo "    snapshot-tool.sh refresh-cache /mnt/dir hostname:/dir"
 	echo "    snapshot-tool.sh clean-cache /dir"
 	echo "    snapshot-tool.sh delete-cache /dir"
-	echo "    snapshot-tool.sh create-snapshot /dir snapshot-1030      
+	echo "    snapshot-tool.sh create-snapshot /dir snapshot-1030"
 	echo "    snapshot-tool.sh delete-snapshot snapshot-1030"
 	
 	exit 1
 }
 
+# Same cache directory as the mount
+if [ "$1" = "-c" -o "$1" = "--cache" ]; then
+	if [ $# -lt 2 ]; then
+		echo "No cache directory specified"
+		exit 1
+	fi
+	CACHE_DIR=$2
+	shift 2
+fi
+
 SNAPSHOTFS=snapshotfs
 if ! (which snapshotfs > /dev/null 2>1); then		
 	if ! (which ./Release/snapshotfs > /dev/null 2>1); then
@@ -46,31 +57,60 @@ if [ "$1" = "refresh-cache" ]; then
 		echo "Invalid number of arguments for $1"
 		exit 1
 	fi
-	$SNAPSHOTFS tool $1 $2 $3	
+	$SNAPSHOTFS tool $1 $2 $3 -c "$CACHE_DIR"
 	exit $?
 elif [ "$1" = "clean-cache" ]; then
 	if [ $# != 2 ]; then
 		echo "Invalid number of arguments for $1"
 		exit 1
 	fi	
-	$SNAPSHOTFS tool $1 $2	
+	$SNAPSHOTFS tool $1 $2 -c "$CACHE_DIR"
 	exit $?
 elif [ "$1" = "delete-cache" ]; then	
 	if [ $# != 2 ]; then
 		echo "Invalid number of arguments for $1"
 		exit 1
 	fi
-	$SNAPSHOTFS tool $1 $2
+	$SNAPSHOTFS tool $1 $2 -c "$CACHE_DIR"
 	exit $?
 elif [ "$1" = "create-snapshot" ]; then	
 	if [ $# != 3 ]; then
 		echo "Invalid number of arguments for $1"
 		exit 1
 	fi
+	# Ask a running mount to save its metadata, so the snapshot mounts warm.
+	# The mount writes its pid file once it handles SIGUSR1 and removes it on unmount.
+	# Each save renames a new file into place, so a changed inode means it is done.
+	METADATA="$CACHE_DIR$2/.%_snapshotfs_metadata"
+	PID_FILE="$CACHE_DIR$2/.%_snapshotfs_pid"
+	if [ -f "$PID_FILE" ]; then
+		PID=$(cat "$PID_FILE")
+		# SIGUSR1 terminates any other process
+		if [ "$(cat "/proc/$PID/comm" 2>/dev/null)" != "snapshotfs" ]; then
+			echo "No snapshotfs process $PID for $2, remove $PID_FILE if the mount is gone"
+			exit 1
+		fi
+		OLD_INODE=$(stat -c %i "$METADATA" 2>/dev/null)
+		kill -USR1 "$PID" || exit 1
+		echo "Saving metadata of $2"
+		SAVED=false
+		for i in $(seq 1 60); do
+			if [ "$(stat -c %i "$METADATA" 2>/dev/null)" != "$OLD_INODE" ]; then
+				SAVED=true
+				break
+			fi
+			sleep 1
+		done
+		if ! $SAVED; then
+			echo "Timed out saving metadata of $2"
+			exit 1
+		fi
+	fi
 	CMD="cp -R -l $CACHE_DIR$2 $CACHE_DIR/$3"
 	echo "Executing: $CMD"
-	$CMD
-	exit $?
+	$CMD || exit $?
+	rm -f "$CACHE_DIR/$3/.%_snapshotfs_pid"
+	exit 0
 elif [ "$1" = "delete-snapshot" ]; then	
 	if [ $# != 2 ]; then
 		echo "Invalid number of arguments for $1"